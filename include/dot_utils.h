@@ -7,7 +7,7 @@
 
 extern mDot* dot;
 
-void config();
+void config(bool warm_boot);
 
 void display_config();
 
@@ -25,6 +25,10 @@ void join_network();
 
 void sleep(bool deepsleep);
 
+void store_first_sample_latency(uint32_t latency_us);
+
+void display_first_sample_latency();
+
 void sleep_wake_rtc_only(bool deepsleep);
 
 void sleep_wake_interrupt_only(bool deepsleep);
@@ -6,9 +6,13 @@
 // if deep_sleep == true, device will enter deepsleep mode
 static bool deep_sleep = true;
 
-mDot* dot = NULL;
+// after waking up from deepsleep the configuration is already saved, the network session is restored from NVM and the frame counters from the RTC backup registers,
+// so the application logs only errors to get to the first sample as soon as possible
+// stdio runs at 115200 baud (see mbed_app.json) and its UART is only brought up when something gets logged
+// if warm_boot_console == true, TRACE logging is enabled on warm boot too (e.g. when USB is attached for debugging)
+static bool warm_boot_console = false;
 
-Serial pc(USBTX, USBRX);
+mDot* dot = NULL;
 
 I2C i2c(I2C_SDA, I2C_SCL);
 ISL29011 lux(i2c);
@@ -35,21 +39,61 @@ int main() {
     uint16_t light;
     std::vector<uint8_t> tx_data;
 
-    pc.baud(115200);
+    // the us ticker is initialized on first use, so main-to-first-sample is measured from here
+    // it does not include the startup code and the global constructors that run before main()
+    uint32_t main_start_us = us_ticker_read();
+
+    // the standby flag is set only if the dot woke up from deepsleep mode
+    // read it directly since it has to be known before the Dot library is initialized, it is confirmed with the library below
+    bool warm_boot = __HAL_PWR_GET_FLAG(PWR_FLAG_SB);
+    bool console = !warm_boot || warm_boot_console;
+    bool first_sample = true;
 
-    mts::MTSLog::setLogLevel(mts::MTSLog::TRACE_LEVEL);
+    mts::MTSLog::setLogLevel(console ? mts::MTSLog::TRACE_LEVEL : mts::MTSLog::ERROR_LEVEL);
 
     dot = mDot::getInstance();
 
-    config();
+    // the standby flag is only cleared by a power-on reset, clear it here once the library has read it
+    // so that a reset after a deepsleep is not taken for a warm boot
+    warm_boot = warm_boot && dot->getStandbyFlag();
+    __HAL_PWR_CLEAR_FLAG(PWR_FLAG_SB);
+
+    if (!warm_boot && !console) {
+        console = true;
+        mts::MTSLog::setLogLevel(mts::MTSLog::TRACE_LEVEL);
+    }
+
+    if (console) {
+        display_first_sample_latency();
+    } else {
+        // the library log level is part of the saved configuration, lower it without saving
+        dot->setLogLevel(mts::MTSLog::ERROR_LEVEL);
+    }
+
+    config(warm_boot);
 
     while (true) {
 
         // Wait for the light sensor to be ready.
-        wait(1);
+        // Not needed on warm boot, the sensor stays powered (in its low power state) during deepsleep.
+        if (!warm_boot || !first_sample) {
+            wait(1);
+        }
 
         light = read_light_sensor_data();
 
+        if (first_sample) {
+            uint32_t main_to_first_sample_us = us_ticker_read() - main_start_us;
+
+            // without console, keep it in a backup register and display it on the next boot with console
+            if (console) {
+                logInfo("%s boot main-to-first-sample: %lu us", warm_boot ? "warm" : "cold", main_to_first_sample_us);
+            } else {
+                store_first_sample_latency(main_to_first_sample_us);
+            }
+            first_sample = false;
+        }
+
         tx_data.clear();
         tx_data.push_back((light >> 8) & 0xFF);
         tx_data.push_back(light & 0xFF);